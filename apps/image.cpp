@@ -6,6 +6,7 @@
 #include "../include/GCanvas.h"
 #include "../include/GColor.h"
 #include "../include/GBitmap.h"
+#include "../include/GTrace.h"
 #include <string>
 
 static int pixel_diff(GPixel p0, GPixel p1) {
@@ -57,18 +58,51 @@ static double compare(const GBitmap& a, const GBitmap& b, int tolerance, bool ve
 
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
-static void handle_proc(const GDrawRec& rec, const char path[], GBitmap* bitmap) {
+static bool draw_proc(const GDrawRec& rec, GBitmap* bitmap, int threadCount) {
     bitmap->alloc(rec.fWidth, rec.fHeight);
 
-    auto canvas = GCreateCanvas(*bitmap);
+    auto canvas = GCreateCanvas(*bitmap, threadCount);
+    if (GTraceIsEnabled()) {
+        canvas = GCreateTraceCanvas(std::move(canvas));
+    }
     if (!canvas) {
         fprintf(stderr, "failed to create canvas for [%d %d] %s\n",
                 rec.fWidth, rec.fHeight, rec.fName);
-        return;
+        return false;
     }
 
     canvas->clear({0, 0, 0, 0});
     rec.fDraw(canvas.get());
+    return true;    // a deferred canvas finishes drawing when it is deleted
+}
+
+static int count_mismatches(const GBitmap& a, const GBitmap& b) {
+    int count = 0;
+    for (int y = 0; y < a.height(); ++y) {
+        for (int x = 0; x < a.width(); ++x) {
+            count += *a.getAddr(x, y) != *b.getAddr(x, y);
+        }
+    }
+    return count;
+}
+
+static void handle_proc(const GDrawRec& rec, const char path[], GBitmap* bitmap,
+                        int threadCount) {
+    GTraceScope trace(rec.fName);
+    if (!draw_proc(rec, bitmap, 0)) {
+        return;
+    }
+
+    // the deferred (and threaded) canvas must match the immediate one exactly
+    if (threadCount > 0) {
+        GBitmap threaded;
+        if (draw_proc(rec, &threaded, threadCount)) {
+            if (int n = count_mismatches(*bitmap, threaded)) {
+                printf(" threads: %d pixels differ", n);
+            }
+        }
+        free(threaded.pixels());
+    }
 
     if (!bitmap->writeToFile(path)) {
         fprintf(stderr, "failed to write %s\n", path);
@@ -149,6 +183,8 @@ int main_image(int argc, const char* argv[]) {
     const char* scoreFile = nullptr;
     FILE* diffFile = NULL;
     int tolerance = 0;
+    int threadCount = 0;
+    const char* traceFile = nullptr;
 
     const char* collage_dir = nullptr;
     int collage_index = -1;
@@ -172,6 +208,11 @@ int main_image(int argc, const char* argv[]) {
         } else if (is_arg(argv[i], "tolerance") && i+1 < argc) {
             tolerance = atoi(argv[++i]);
             assert(tolerance >= 0);
+        } else if (is_arg(argv[i], "threads") && i+1 < argc) {
+            threadCount = atoi(argv[++i]);
+        } else if (is_arg(argv[i], "trace") && i+1 < argc) {
+            traceFile = argv[++i];
+            GTraceStart();
         } else if (is_arg(argv[i], "scoreFile") && i+1 < argc) {
             scoreFile = argv[++i];
         } else if (is_arg(argv[i], "diff") && i+1 < argc) {
@@ -228,7 +269,7 @@ int main_image(int argc, const char* argv[]) {
         }
         
         GBitmap testBM;
-        handle_proc(gDrawRecs[i], path.c_str(), &testBM);
+        handle_proc(gDrawRecs[i], path.c_str(), &testBM, threadCount);
 
         if (expected && !something) {
             std::string exp_path(expected);
@@ -259,6 +300,9 @@ int main_image(int argc, const char* argv[]) {
     if (diffFile) {
         fclose(diffFile);
     }
+    if (traceFile && !GTraceStopAndWrite(traceFile)) {
+        printf("FAILED TO WRITE TO %s\n", traceFile);
+    }
 
     constexpr double num_required = 2;
 
@@ -0,0 +1,29 @@
+/*
+ *  Copyright 2024 Mike Reed
+ */
+
+#ifndef GCPU_DEFINED
+#define GCPU_DEFINED
+
+#include "GTypes.h"
+
+/**
+ *  Instruction-set levels that our pixel loops can be specialized for. Each level implies
+ *  the ones before it.
+ */
+enum class GCPULevel {
+    kScalar,
+    kSSE41,
+    kAVX2,
+    kAVX512,    // AVX-512 F + BW
+};
+
+/**
+ *  Returns the highest level supported by this CPU (always kScalar on non-x86 builds).
+ *
+ *  Setting the environment variable G_CPU_LEVEL to scalar, sse41, avx2 or avx512 lowers this
+ *  to that level, e.g. to test a specific variant. The result is computed once, on first use.
+ */
+GCPULevel GGetCPULevel();
+
+#endif
@@ -14,13 +14,58 @@ class GPath;
 class GPoint;
 class GRect;
 
+/**
+ *  Counters that a canvas keeps about the work it has done, to explain where the time goes
+ *  without attaching a profiler (see GCanvas::getStats()). A canvas only fills in the counters
+ *  that apply to it, e.g. a recording canvas counts draws, but blits no pixels.
+ */
+struct GCanvasStats {
+    enum DrawType {
+        kClear_DrawType,
+        kRect_DrawType,
+        kConvexPolygon_DrawType,
+        kPath_DrawType,
+        kMesh_DrawType,
+        kQuad_DrawType,
+    };
+    static constexpr int kDrawTypeCount = kQuad_DrawType + 1;
+    static constexpr int kBlendModeCount = (int)GBlendMode::kXor + 1;
+
+    uint64_t fDraws[kDrawTypeCount] = {};   // draw calls made on the canvas
+    uint64_t fDrawsCulled = 0;              // draws skipped as hidden or offscreen
+    uint64_t fSpans[kBlendModeCount] = {};  // blitted rows, by the paint's blendmode
+    uint64_t fPixels[kBlendModeCount] = {}; // blitted pixels, by the paint's blendmode
+    uint64_t fShadeRowCalls = 0;
+    uint64_t fShadedPixels = 0;
+    uint64_t fTrianglesDrawn = 0;
+    uint64_t fTrianglesCulled = 0;          // e.g. empty, or outside the clip
+    uint64_t fEdges = 0;                    // edges built for the scan converter
+
+    GCanvasStats& operator+=(const GCanvasStats& other) {
+        for (int i = 0; i < kDrawTypeCount; ++i) {
+            fDraws[i] += other.fDraws[i];
+        }
+        for (int i = 0; i < kBlendModeCount; ++i) {
+            fSpans[i] += other.fSpans[i];
+            fPixels[i] += other.fPixels[i];
+        }
+        fDrawsCulled += other.fDrawsCulled;
+        fShadeRowCalls += other.fShadeRowCalls;
+        fShadedPixels += other.fShadedPixels;
+        fTrianglesDrawn += other.fTrianglesDrawn;
+        fTrianglesCulled += other.fTrianglesCulled;
+        fEdges += other.fEdges;
+        return *this;
+    }
+};
+
 class GCanvas {
 public:
     virtual ~GCanvas() {}
 
     /**
-     *  Save off a copy of the canvas state (CTM), to be later used if the balancing call to
-     *  restore() is made. Calls to save/restore can be nested:
+     *  Save off a copy of the canvas state (CTM and clip), to be later used if the balancing call
+     *  to restore() is made. Calls to save/restore can be nested:
      *  save();
      *      save();
      *          concat(...);    // this modifies the CTM
@@ -32,8 +77,9 @@ public:
     virtual void save() = 0;
 
     /**
-     *  Copy the canvas state (CTM) that was record in the correspnding call to save() back into
-     *  the canvas. It is an error to call restore() if there has been no previous call to save().
+     *  Copy the canvas state (CTM and clip) that was record in the correspnding call to save()
+     *  back into the canvas. It is an error to call restore() if there has been no previous call
+     *  to save().
      */
     virtual void restore() = 0;
 
@@ -46,7 +92,20 @@ public:
     virtual void concat(const GMatrix& matrix) = 0;
 
     /**
-     *  Fill the entire canvas with the specified color, using kSrc porter-duff mode.
+     *  Intersect the clip with the rectangle, transformed by the CTM. After this, draws only
+     *  affect pixels that are inside the clip, following the same "containment" rule as
+     *  drawRect(). The canvas is constructed with a clip of the entire bitmap.
+     */
+    virtual void clipRect(const GRect&) = 0;
+
+    /**
+     *  Intersect the clip with the path (using winding-fill), transformed by the CTM.
+     */
+    virtual void clipPath(const GPath&) = 0;
+
+    /**
+     *  Fill the entire canvas (inside the clip) with the specified color, using kSrc porter-duff
+     *  mode.
      */
     virtual void clear(const GColor&) = 0;
 
@@ -136,6 +195,20 @@ public:
     virtual void drawQuad(const GPoint verts[4], const GColor colors[4], const GPoint texs[4],
                           int level, const GPaint&) = 0;
 
+    /**
+     *  Return the counters accumulated since the canvas was created, or since the last call to
+     *  resetStats(). They are only kept in builds that define G_STATS (see GSTATSCODE):
+     *  otherwise, and for canvases that keep no counters, this returns all zeros.
+     */
+    virtual GCanvasStats getStats() const { return GCanvasStats(); }
+    virtual void resetStats() {}
+
+    /**
+     *  Complete any drawing that the canvas has deferred, so that the bitmap's pixels (and the
+     *  stats) are final. Most canvases draw immediately, so by default this does nothing.
+     */
+    virtual void finish() {}
+
     // Helpers
 
     void translate(float x, float y) {
@@ -166,6 +239,19 @@ public:
  */
 std::unique_ptr<GCanvas> GCreateCanvas(const GBitmap& bitmap);
 
+/**
+ *  Returns a "deferred" canvas: it records its draws, and then rasterizes them into the bitmap
+ *  on threadCount threads on finish(), or when the canvas is destroyed (see
+ *  GPicture::playback()). Draws that are completely covered by later opaque rects are never
+ *  rasterized. Its stats count the draw calls made on it, plus the spans, pixels, triangles and
+ *  edges of the canvases that did the rasterizing.
+ *
+ *  finish() keeps the CTM, clip and saves, so drawing can go on after it, as with any canvas.
+ *
+ *  If threadCount <= 0, this is the same as GCreateCanvas(bitmap).
+ */
+std::unique_ptr<GCanvas> GCreateCanvas(const GBitmap& bitmap, int threadCount);
+
 /**
  *  Implement this, drawing into the provided canvas, and returning the title of your artwork.
  */
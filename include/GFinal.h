@@ -8,6 +8,7 @@
 #include "GCanvas.h"
 #include "GPath.h"
 #include "GShader.h"
+#include <algorithm>
 #include <array>
 
 /* A 4x5 matrix to transform unpremul GColors.
@@ -42,6 +43,103 @@ struct GColorMatrix {
         assert(i < 20);
         return fMat[i];
     }
+
+    /**
+     *  Return the matrix that applies b, and then a. Applying it is the same as applying b and
+     *  then a, as long as b's results did not need clamping (see preservesRange()). This lets
+     *  nested color matrix shaders make a single pass over the pixels.
+     */
+    static GColorMatrix Concat(const GColorMatrix& a, const GColorMatrix& b) {
+        GColorMatrix m;
+        for (int i = 0; i < 4; ++i) {           // row (output component)
+            for (int j = 0; j < 4; ++j) {       // column (input component)
+                float sum = 0;
+                for (int k = 0; k < 4; ++k) {
+                    sum += a.fMat[k*4 + i] * b.fMat[j*4 + k];
+                }
+                m.fMat[j*4 + i] = sum;
+            }
+            float sum = a.fMat[16 + i];
+            for (int k = 0; k < 4; ++k) {
+                sum += a.fMat[k*4 + i] * b.fMat[16 + k];
+            }
+            m.fMat[16 + i] = sum;
+        }
+        return m;
+    }
+
+    friend GColorMatrix operator*(const GColorMatrix& a, const GColorMatrix& b) {
+        return Concat(a, b);
+    }
+
+    /**
+     *  Return the (unpremul) color transformed by the matrix, without clamping.
+     *
+     *  The matrix is affine, so it can be applied to a color before or after lerping between
+     *  colors, with the same result. e.g. a solid color, or a gradient's stops, can be
+     *  transformed up front rather than per pixel, if none of the results need clamping.
+     */
+    GColor apply(const GColor& c) const {
+        auto row = [this, &c](int i) {
+            return fMat[i] * c.r + fMat[4 + i] * c.g + fMat[8 + i] * c.b + fMat[12 + i] * c.a +
+                   fMat[16 + i];
+        };
+        return GColor::RGBA(row(0), row(1), row(2), row(3));
+    }
+
+    /**
+     *  Returns true if every legal color (all components in [0..1]) is transformed into another
+     *  legal color, so that the results never need clamping.
+     */
+    bool preservesRange() const {
+        for (int i = 0; i < 4; ++i) {
+            float lo = fMat[16 + i],
+                  hi = fMat[16 + i];
+            for (int k = 0; k < 4; ++k) {
+                lo += std::min(fMat[k*4 + i], 0.0f);
+                hi += std::max(fMat[k*4 + i], 0.0f);
+            }
+            if (lo < 0 || hi > 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     *  Returns true if each component only depends on its own input (and the translate), e.g.
+     *  a brightness or invert matrix. Each channel can then be mapped on its own.
+     */
+    bool isDiagonal() const {
+        for (int j = 0; j < 4; ++j) {
+            for (int i = 0; i < 4; ++i) {
+                if (i != j && fMat[j*4 + i] != 0) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     *  Returns true if the output alpha is the input alpha, so a shader that applies this
+     *  matrix is opaque if its real shader is, and can skip any work on alpha.
+     */
+    bool preservesAlpha() const {
+        return fMat[3] == 0 && fMat[7] == 0 && fMat[11] == 0 && fMat[15] == 1 && fMat[19] == 0;
+    }
+
+    /**
+     *  Returns true if the output alpha is 1 (after clamping) for every legal input color, so a
+     *  shader that applies this matrix is opaque no matter what its real shader returns.
+     */
+    bool isOpaqueOutput() const {
+        float lo = fMat[19];
+        for (int k = 0; k < 4; ++k) {
+            lo += std::min(fMat[k*4 + 3], 0.0f);
+        }
+        return lo >= 1;
+    }
 };
 
 /**
@@ -51,6 +51,28 @@ public:
     }
     bool operator!=(const GMatrix& m) { return !(*this == m); }
 
+    enum TypeMask {
+        kIdentity_Mask  = 0,
+        kTranslate_Mask = 1 << 0,   // e or f != 0
+        kScale_Mask     = 1 << 1,   // a or d != 1
+        kAffine_Mask    = 1 << 2,   // b or c != 0 (rotate or skew)
+    };
+
+    /**
+     *  Return the combination of TypeMask bits that describes this matrix, so callers can pick
+     *  a cheaper path (e.g. just adding e,f when the type is kTranslate_Mask). The type is
+     *  computed on each call (operator[] can change any element), but it is only a few compares.
+     */
+    unsigned getType() const {
+        return (fMat[4] != 0 || fMat[5] != 0 ? kTranslate_Mask : 0) |
+               (fMat[0] != 1 || fMat[3] != 1 ? kScale_Mask : 0) |
+               (fMat[1] != 0 || fMat[2] != 0 ? kAffine_Mask : 0);
+    }
+
+    bool isIdentity() const { return this->getType() == kIdentity_Mask; }
+    bool isTranslate() const { return (this->getType() & ~kTranslate_Mask) == 0; }
+    bool isScaleTranslate() const { return (this->getType() & kAffine_Mask) == 0; }
+
     ///////////////////////////////////////////////////////////////////////////////////////////////
     // These methods must be implemented by the student.
 
@@ -0,0 +1,81 @@
+/*
+ *  Copyright 2024 Mike Reed
+ */
+
+#ifndef GMesh_DEFINED
+#define GMesh_DEFINED
+
+#include "GCanvas.h"
+#include "GColor.h"
+#include "GMatrix.h"
+#include "GPaint.h"
+#include "GPoint.h"
+
+#include <vector>
+
+enum class GMeshMode {
+    kTriangles,     // each 3 indices form a triangle
+    kTriangleStrip, // each index after the first 2 forms a triangle with the 2 before it
+    kTriangleFan,   // each index after the first 2 forms a triangle with the previous and the first
+};
+
+/**
+ *  An immutable triangle mesh, that can be drawn many times.
+ *
+ *  The verts, colors and texs are copied once, and the indices (of any mode, int or 16-bit) are
+ *  expanded into a triangle list once, when the mesh is created, rather than on every draw.
+ *
+ *  Each draw still goes through GCanvas::drawMesh(), which maps the verts by the CTM per
+ *  triangle. Mapping each shared vertex once per CTM would need support from the canvas.
+ */
+class GMesh {
+public:
+    int countVerts() const { return (int)fVerts.size(); }
+    int countTriangles() const { return (int)fIndices.size() / 3; }
+
+    /**
+     *  Draw the mesh with the paint, as if the matrix had been concatenated to the canvas' CTM.
+     *  See GCanvas::drawMesh() for how the colors and texs are applied.
+     */
+    void draw(GCanvas*, const GMatrix&, const GPaint&) const;
+
+    void draw(GCanvas* canvas, const GPaint& paint) const {
+        this->draw(canvas, GMatrix(), paint);
+    }
+
+private:
+    GMesh() {}
+    GMesh(const GMesh&) = delete;
+    GMesh& operator=(const GMesh&) = delete;
+
+    template <typename T> static std::shared_ptr<GMesh> Make(GMeshMode, int, const GPoint[],
+                                                            const GColor[], const GPoint[],
+                                                            int, const T[]);
+
+    friend std::shared_ptr<GMesh> GCreateMesh(GMeshMode, int, const GPoint[], const GColor[],
+                                              const GPoint[], int, const int[]);
+    friend std::shared_ptr<GMesh> GCreateMesh(GMeshMode, int, const GPoint[], const GColor[],
+                                              const GPoint[], int, const uint16_t[]);
+
+    std::vector<GPoint> fVerts;
+    std::vector<GColor> fColors;    // empty, or one per vert
+    std::vector<GPoint> fTexs;      // empty, or one per vert
+    std::vector<int>    fIndices;   // 3 per triangle
+};
+
+/**
+ *  Return a mesh of vertexCount verts (colors and texs are optional, as in drawMesh), whose
+ *  triangles are formed from the indices according to the mode. If indices is null, then
+ *  indexCount is ignored, and the verts are used in order (as if indices were 0, 1, 2, ...).
+ *
+ *  The arrays are copied. Returns null if vertexCount <= 0, or if an index is out of range.
+ */
+std::shared_ptr<GMesh> GCreateMesh(GMeshMode, int vertexCount, const GPoint verts[],
+                                   const GColor colors[], const GPoint texs[],
+                                   int indexCount, const int indices[]);
+
+std::shared_ptr<GMesh> GCreateMesh(GMeshMode, int vertexCount, const GPoint verts[],
+                                   const GColor colors[], const GPoint texs[],
+                                   int indexCount, const uint16_t indices[]);
+
+#endif
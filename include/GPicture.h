@@ -0,0 +1,209 @@
+/*
+ *  Copyright 2024 Mike Reed
+ */
+
+#ifndef GPicture_DEFINED
+#define GPicture_DEFINED
+
+#include "GBitmap.h"
+#include "GCanvas.h"
+#include "GColor.h"
+#include "GMatrix.h"
+#include "GPaint.h"
+#include "GPath.h"
+#include "GPoint.h"
+#include "GRect.h"
+
+#include <vector>
+
+/**
+ *  An immutable display list of draw calls, created by GRecordingCanvas::detach().
+ *
+ *  The recorder folds the CTM into each draw, so a picture holds no save/restore/concat ops:
+ *  each draw refers to the (pre-concatenated) matrix it was recorded with. Likewise each draw
+ *  refers to its clip, recorded in picture-space: the intersection of the rect clips, plus any
+ *  path clips.
+ *
+ *  Draws that are hidden by later opaque, axis-aligned rects (or a clear) are dropped.
+ *
+ *  Runs of drawRect/drawConvexPolygon that share a paint, matrix and clip, and do not overlap, are
+ *  merged into a single drawPath, so the canvas only sets up the paint (and shader) once. A run
+ *  never spans more than one playback tile (256x256 device pixels): a merged path is drawn in
+ *  every tile its bounds touch, so a wider run would re-rasterize all its edges in each of them.
+ */
+class GPicture {
+public:
+    /**
+     *  Replay the draws into the canvas, each under (canvas' CTM) * (recorded CTM), and inside
+     *  the canvas' clip. The canvas' CTM and clip are unchanged on return.
+     */
+    void playback(GCanvas*) const;
+
+    /**
+     *  Same as playback(canvas), but skip the draws whose bounds (under their recorded CTM and
+     *  clip) do not touch cullRect, which is in the picture's coordinates: e.g. the part of the
+     *  picture that a scrolled or zoomed view can show. This only drops whole draws, so what
+     *  lands inside cullRect is the same as with playback(canvas).
+     */
+    void playback(GCanvas*, const GRect& cullRect) const;
+
+    /**
+     *  Rasterize the picture into the bitmap. The draws are binned into tiles (by their device
+     *  bounds), and the tiles are then drawn in parallel on threadCount threads, each tile with
+     *  its own canvas from GCreateCanvas(), clipped to the tile. Draws keep their order within
+     *  each tile.
+     *
+     *  Shaders are stateful (setContext), so draws with a shader are serialized across tiles.
+     *  If threadCount <= 1, the picture is drawn into a single canvas without tiling. Either
+     *  way, draws that miss the bitmap are skipped.
+     *
+     *  If stats is not null, the stats of every canvas used are added to it.
+     */
+    void playback(const GBitmap&, int threadCount, GCanvasStats* stats = nullptr) const;
+
+    int countOps() const { return (int)fOps.size(); }
+
+private:
+    enum class OpType : uint8_t {
+        kClear,
+        kRect,
+        kConvexPolygon,
+        kPath,
+        kMesh,
+        kQuad,
+    };
+
+    enum {
+        kHasColors_MeshFlag = 1 << 0,
+        kHasTexs_MeshFlag   = 1 << 1,
+    };
+
+    struct Op {
+        OpType  type;
+        uint8_t flags;
+        int     matrix;     // index into fMatrices (0 is identity)
+        int     clip;       // index into fClips (0 is wide open)
+        int     paint;      // index into fPaints (or fColors for kClear)
+        int     data;       // offset into fPoints/fColors/fIndices, or fPaths
+        int     count;      // points, triangles, or quad-level
+    };
+
+    struct Clip {
+        GRect rect;         // intersection of the rect clips
+        bool  hasRect;
+        int   paths;        // index into fClipPaths of the newest path clip, or -1
+    };
+
+    struct ClipPath {
+        int path;           // index into fPaths
+        int prev;           // index into fClipPaths of the previous path clip, or -1
+    };
+
+    // what playback has set up in the canvas, inside its save()
+    struct State {
+        int matrix;
+        int clip;
+    };
+
+    GPicture() {}
+    GPicture(const GPicture&) = delete;
+    GPicture& operator=(const GPicture&) = delete;
+
+    GIRect deviceBounds(const Op&) const;
+    GIRect clippedBounds(const Op&) const;
+    bool isOpaqueRect(const Op&, GIRect* covered) const;
+    void cullOccluded();
+    void mergeRuns();
+    void applyClip(GCanvas*, int clip) const;
+    void drawOp(GCanvas*, const Op&, State*) const;
+
+    friend class GRecordingCanvas;
+
+    std::vector<Op>                     fOps;
+    std::vector<GMatrix>                fMatrices;
+    std::vector<Clip>                   fClips;
+    std::vector<ClipPath>               fClipPaths;
+    std::vector<GPaint>                 fPaints;
+    std::vector<GPoint>                 fPoints;    // verts and texs
+    std::vector<GColor>                 fColors;
+    std::vector<int>                    fIndices;
+    std::vector<std::shared_ptr<GPath>> fPaths;
+};
+
+/**
+ *  A canvas that records its draws into a GPicture, rather than drawing any pixels.
+ *
+ *  GRecordingCanvas recorder;
+ *  draw_scene(&recorder);
+ *  auto picture = recorder.detach();
+ *  ...
+ *  picture->playback(canvas);
+ */
+class GRecordingCanvas : public GCanvas {
+public:
+    GRecordingCanvas();
+
+    void save() override;
+    void restore() override;
+    void concat(const GMatrix&) override;
+    void clipRect(const GRect&) override;
+    void clipPath(const GPath&) override;
+    void clear(const GColor&) override;
+    void drawRect(const GRect&, const GPaint&) override;
+    void drawConvexPolygon(const GPoint[], int count, const GPaint&) override;
+    void drawPath(const GPath&, const GPaint&) override;
+    void drawMesh(const GPoint verts[], const GColor colors[], const GPoint texs[],
+                  int count, const int indices[], const GPaint&) override;
+    void drawQuad(const GPoint verts[4], const GColor colors[4], const GPoint texs[4],
+                  int level, const GPaint&) override;
+
+    /**
+     *  Return a picture of everything drawn so far, and then reset the recorder back to its
+     *  initial state (identity CTM, wide open clip, no draws).
+     *
+     *  Recording is often repeated frame after frame, so if the recorder is used again, its
+     *  first draw reserves room for as much as this picture recorded.
+     */
+    std::shared_ptr<GPicture> detach();
+
+    /**
+     *  Same as detach(), but the recorder keeps its CTM, clip and saves: later draws (and
+     *  restores) carry on as if nothing had been detached.
+     */
+    std::shared_ptr<GPicture> detachDraws();
+
+    /**
+     *  Counts the draws made on the recorder, and (at detach) the ones dropped as hidden.
+     */
+    GCanvasStats getStats() const override { GSTATSCODE(return fStats;) return GCanvasStats(); }
+    void resetStats() override { GSTATSCODE(fStats = GCanvasStats();) }
+
+private:
+    struct State {
+        GMatrix fCTM;
+        int     fClip;      // index into GPicture::fClips
+    };
+
+    // array sizes of the last detached picture, as recorded (before culling and merging)
+    struct Sizes {
+        size_t ops, matrices, clips, clipPaths, paints, points, colors, indices, paths;
+    };
+
+    std::unique_ptr<GPicture> fPicture;
+    std::vector<State>        fStack;         // fStack.back() is the current state
+    int                       fMatrixIndex;   // -1 if the CTM changed since the last draw
+    Sizes                     fLastSizes = {};
+    bool                      fReserveLastSizes = false;
+    GSTATSCODE(GCanvasStats   fStats;)
+
+    void newPicture();
+    void reset();
+    std::shared_ptr<GPicture> finishPicture(std::unique_ptr<GPicture>);
+    int copyClip(const GPicture& src, int clip, std::vector<int>* clips,
+                 std::vector<int>* clipPaths);
+    void reserveLastSizes();
+    void addClip(const GPicture::Clip&);
+    GPicture::Op& addOp(GPicture::OpType, const GPaint&);
+};
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ *  Copyright 2024 Mike Reed
+ */
+
+#ifndef GTrace_DEFINED
+#define GTrace_DEFINED
+
+#include "GCanvas.h"
+
+/**
+ *  Timeline tracing, written as Chrome trace-event JSON (load it in chrome://tracing, or
+ *  ui.perfetto.dev). Each event is a named span of time on the thread that ran it.
+ *
+ *  void draw_scene(GCanvas* canvas) {
+ *      GTRACE("draw_scene");
+ *      ...
+ *  }
+ *
+ *  Tracing is off until GTraceStart(). While it is off, GTRACE costs one (relaxed) atomic load.
+ */
+void GTraceStart();
+
+/**
+ *  Stop tracing, and write the events collected since GTraceStart() to the file.
+ *  Returns false if the file could not be written.
+ */
+bool GTraceStopAndWrite(const char path[]);
+
+bool GTraceIsEnabled();
+
+/**
+ *  Records an event from its construction to its destruction. The name is not copied, so it
+ *  must outlive the trace (e.g. a string literal).
+ */
+class GTraceScope {
+public:
+    explicit GTraceScope(const char name[]);
+    ~GTraceScope();
+
+private:
+    const char* fName;      // null if tracing was off when we started
+    int64_t     fStartNS;
+};
+
+#define GTRACE(name)    GTraceScope gTraceScope_(name)
+
+/**
+ *  Returns a canvas that traces each call (e.g. "GCanvas::drawPath") and forwards it to the
+ *  canvas it owns. When it is destroyed, so is that canvas.
+ */
+std::unique_ptr<GCanvas> GCreateTraceCanvas(std::unique_ptr<GCanvas>);
+
+#endif
@@ -26,6 +26,14 @@
     #define GDEBUGCODE(code)    code
 #endif
 
+// Canvas performance counters (see GCanvas::getStats()) are only kept in builds that define
+// G_STATS. Otherwise the code that updates them compiles to nothing.
+#ifdef G_STATS
+    #define GSTATSCODE(code)    code
+#else
+    #define GSTATSCODE(code)
+#endif
+
 /**
  *  Given an array (not a pointer), this macro will return the number of
  *  elements declared in that array.
@@ -3,8 +3,34 @@
  */
 
 #include "../include/GBitmap.h"
+#include "../include/GCPU.h"
+#include "../include/GTrace.h"
 #include "lodepng.h"
 
+#include <array>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define G_CPU_X86
+#endif
+
+/*
+ *  gUnpremulScale[a] = 2^32 / a + 1, so that (x * 255 + a/2) / a, for x <= 255, can be done
+ *  with a multiply and a shift rather than a divide. The result is exact: the error is less
+ *  than 2 * 2^16 / 2^32, and the quotient is never within 1/a of the next integer.
+ */
+static const std::array<uint64_t, 256> gUnpremulScale = []() {
+    std::array<uint64_t, 256> table = {};
+    for (uint64_t a = 1; a < 256; ++a) {
+        table[a] = ((uint64_t)1 << 32) / a + 1;
+    }
+    return table;
+}();
+
+static inline int unpremul(int x, int a) {
+    return (int)(((uint64_t)(x * 255 + a/2) * gUnpremulScale[a]) >> 32);
+}
+
 static void convertToPNG(const GPixel src[], int width, uint8_t dst[]) {
     for (int i = 0; i < width; i++) {
         GPixel c = *src++;
@@ -15,9 +41,9 @@ static void convertToPNG(const GPixel src[], int width, uint8_t dst[]) {
         
         // PNG requires unpremultiplied, but GPixel is premultiplied
         if (0 != a && 255 != a) {
-            r = (r * 255 + a/2) / a;
-            g = (g * 255 + a/2) / a;
-            b = (b * 255 + a/2) / a;
+            r = unpremul(r, a);
+            g = unpremul(g, a);
+            b = unpremul(b, a);
         }
         *dst++ = r;
         *dst++ = g;
@@ -26,17 +52,81 @@ static void convertToPNG(const GPixel src[], int width, uint8_t dst[]) {
     }
 }
 
+#ifdef G_CPU_X86
+
+// Swaps bytes 0 and 2 of each pixel: RGBA <--> BGRA (our GPixel layout in memory)
+#define G_SWAP_RB_BYTES   2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15
+
+/*
+ *  Opaque (and fully transparent) pixels need no unpremul, so we just swizzle them, 4 or 8 at
+ *  a time. Any group with a partial alpha goes through convertToPNG().
+ */
+__attribute__((target("sse4.1")))
+static void convertToPNG_sse41(const GPixel src[], int width, uint8_t dst[]) {
+    const __m128i swap = _mm_setr_epi8(G_SWAP_RB_BYTES);
+    const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+    for (; width >= 4; width -= 4, src += 4, dst += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)src);
+        const __m128i a = _mm_and_si128(v, alphaMask);
+        const __m128i zeroOrOpaque = _mm_or_si128(_mm_cmpeq_epi32(a, alphaMask),
+                                                  _mm_cmpeq_epi32(a, _mm_setzero_si128()));
+        if (_mm_movemask_epi8(zeroOrOpaque) == 0xFFFF) {
+            _mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi8(v, swap));
+        } else {
+            convertToPNG(src, 4, dst);
+        }
+    }
+    convertToPNG(src, width, dst);
+}
+
+__attribute__((target("avx2")))
+static void convertToPNG_avx2(const GPixel src[], int width, uint8_t dst[]) {
+    const __m256i swap = _mm256_setr_epi8(G_SWAP_RB_BYTES, G_SWAP_RB_BYTES);
+    const __m256i alphaMask = _mm256_set1_epi32((int)0xFF000000);
+    for (; width >= 8; width -= 8, src += 8, dst += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)src);
+        const __m256i a = _mm256_and_si256(v, alphaMask);
+        const __m256i zeroOrOpaque = _mm256_or_si256(_mm256_cmpeq_epi32(a, alphaMask),
+                                                     _mm256_cmpeq_epi32(a, _mm256_setzero_si256()));
+        if (_mm256_movemask_epi8(zeroOrOpaque) == -1) {
+            _mm256_storeu_si256((__m256i*)dst, _mm256_shuffle_epi8(v, swap));
+        } else {
+            convertToPNG(src, 8, dst);
+        }
+    }
+    convertToPNG_sse41(src, width, dst);
+}
+
+#endif
+
+using ConvertToPNGProc = void (*)(const GPixel[], int, uint8_t[]);
+
+static ConvertToPNGProc choose_convertToPNG() {
+#ifdef G_CPU_X86
+    switch (GGetCPULevel()) {
+        case GCPULevel::kAVX512:
+        case GCPULevel::kAVX2:   return convertToPNG_avx2;
+        case GCPULevel::kSSE41:  return convertToPNG_sse41;
+        case GCPULevel::kScalar: break;
+    }
+#endif
+    return convertToPNG;
+}
+
 bool GBitmap::writeToFile(const char path[]) const {
+    GTRACE("GBitmap::writeToFile");
     size_t rb = this->width() * 4;
     uint8_t* pix = (uint8_t*)malloc(this->height() * rb);
     if (!pix) {
         return false;
     }
 
+    static const ConvertToPNGProc proc = choose_convertToPNG();
+
     const GPixel* src = this->pixels();
     uint8_t* dst = pix;
     for (int y = 0; y < this->height(); ++y) {
-        convertToPNG(src, this->width(), dst);
+        proc(src, this->width(), dst);
         src += this->rowBytes() / 4;
         dst += rb;
     }
@@ -63,7 +153,94 @@ static void swizzle_rgba_row(GPixel dst[], const uint8_t src[], int count) {
     }
 }
 
+#ifdef G_CPU_X86
+
+/*
+ *  These compute the same values as swizzle_rgba_row(): the alpha lanes are multiplied by 255,
+ *  so every lane is (x*y + 127) / 255, and x/255 == (x * 0x8081) >> 23 for all 16-bit x.
+ */
+__attribute__((target("sse4.1")))
+static __m128i premul_sse41(__m128i bgra16) {
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(bgra16, 0xFF), 0xFF);
+    a = _mm_blend_epi16(a, _mm_set1_epi16(255), 0x88);
+    const __m128i x = _mm_add_epi16(_mm_mullo_epi16(bgra16, a), _mm_set1_epi16(127));
+    return _mm_srli_epi16(_mm_mulhi_epu16(x, _mm_set1_epi16((short)0x8081)), 7);
+}
+
+__attribute__((target("sse4.1")))
+static void swizzle_rgba_row_sse41(GPixel dst[], const uint8_t src[], int count) {
+    const __m128i swap = _mm_setr_epi8(G_SWAP_RB_BYTES);
+    for (; count >= 4; count -= 4, src += 16, dst += 4) {
+        const __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)src), swap);
+        const __m128i lo = premul_sse41(_mm_cvtepu8_epi16(v));
+        const __m128i hi = premul_sse41(_mm_unpackhi_epi8(v, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(lo, hi));
+    }
+    swizzle_rgba_row(dst, src, count);
+}
+
+__attribute__((target("avx2")))
+static __m256i premul_avx2(__m256i bgra16) {
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(bgra16, 0xFF), 0xFF);
+    a = _mm256_blend_epi16(a, _mm256_set1_epi16(255), 0x88);
+    const __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(bgra16, a), _mm256_set1_epi16(127));
+    return _mm256_srli_epi16(_mm256_mulhi_epu16(x, _mm256_set1_epi16((short)0x8081)), 7);
+}
+
+__attribute__((target("avx2")))
+static void swizzle_rgba_row_avx2(GPixel dst[], const uint8_t src[], int count) {
+    const __m256i swap = _mm256_setr_epi8(G_SWAP_RB_BYTES, G_SWAP_RB_BYTES);
+    for (; count >= 8; count -= 8, src += 32, dst += 8) {
+        const __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)src), swap);
+        const __m256i lo = premul_avx2(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+        const __m256i hi = premul_avx2(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+        // packus works within each 128-bit lane, so put the 64-bit quarters back in order
+        const __m256i packed = _mm256_packus_epi16(lo, hi);
+        _mm256_storeu_si256((__m256i*)dst, _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    swizzle_rgba_row_sse41(dst, src, count);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static __m512i premul_avx512(__m512i bgra16) {
+    __m512i a = _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(bgra16, 0xFF), 0xFF);
+    a = _mm512_mask_blend_epi16(0x88888888, a, _mm512_set1_epi16(255));
+    const __m512i x = _mm512_add_epi16(_mm512_mullo_epi16(bgra16, a), _mm512_set1_epi16(127));
+    return _mm512_srli_epi16(_mm512_mulhi_epu16(x, _mm512_set1_epi16((short)0x8081)), 7);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void swizzle_rgba_row_avx512(GPixel dst[], const uint8_t src[], int count) {
+    const __m512i swap = _mm512_broadcast_i32x4(_mm_setr_epi8(G_SWAP_RB_BYTES));
+    for (; count >= 16; count -= 16, src += 64, dst += 16) {
+        const __m512i v = _mm512_shuffle_epi8(_mm512_loadu_si512(src), swap);
+        const __m512i lo = premul_avx512(_mm512_cvtepu8_epi16(_mm512_castsi512_si256(v)));
+        const __m512i hi = premul_avx512(_mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(v, 1)));
+        // packus works within each 128-bit lane, so put the 64-bit quarters back in order
+        const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+        _mm512_storeu_si512(dst, _mm512_permutexvar_epi64(order, _mm512_packus_epi16(lo, hi)));
+    }
+    swizzle_rgba_row_avx2(dst, src, count);
+}
+
+#endif
+
+using SwizzleProc = void (*)(GPixel[], const uint8_t[], int);
+
+static SwizzleProc choose_swizzle_rgba_row() {
+#ifdef G_CPU_X86
+    switch (GGetCPULevel()) {
+        case GCPULevel::kAVX512: return swizzle_rgba_row_avx512;
+        case GCPULevel::kAVX2:   return swizzle_rgba_row_avx2;
+        case GCPULevel::kSSE41:  return swizzle_rgba_row_sse41;
+        case GCPULevel::kScalar: break;
+    }
+#endif
+    return swizzle_rgba_row;
+}
+
 bool GBitmap::readFromFile(const char path[]) {
+    GTRACE("GBitmap::readFromFile");
     unsigned w, h;
     unsigned char* pix = nullptr;
     if (lodepng_decode32_file(&pix, &w, &h, path)) {
@@ -73,11 +250,13 @@ bool GBitmap::readFromFile(const char path[]) {
 
     this->alloc(w, h);
 
+    static const SwizzleProc proc = choose_swizzle_rgba_row();
+
     GPixel* dst = this->pixels();
     const uint8_t* src = pix;
     size_t rb = w * 4;
     for (unsigned y = 0; y < h; ++y) {
-        swizzle_rgba_row(dst, src, w);
+        proc(dst, src, w);
         src += rb;
         dst += this->rowBytes() / 4;
     }
@@ -0,0 +1,56 @@
+/*
+ *  Copyright 2024 Mike Reed
+ */
+
+#include "../include/GCPU.h"
+
+#include <algorithm>
+
+static GCPULevel detect_level() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return GCPULevel::kAVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return GCPULevel::kAVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return GCPULevel::kSSE41;
+    }
+#endif
+    return GCPULevel::kScalar;
+}
+
+static GCPULevel compute_level() {
+    GCPULevel level = detect_level();
+
+    if (const char* env = getenv("G_CPU_LEVEL")) {
+        const struct {
+            const char* fName;
+            GCPULevel   fLevel;
+        } gNames[] = {
+            { "scalar", GCPULevel::kScalar },
+            { "sse41",  GCPULevel::kSSE41  },
+            { "avx2",   GCPULevel::kAVX2   },
+            { "avx512", GCPULevel::kAVX512 },
+        };
+        bool found = false;
+        for (const auto& rec : gNames) {
+            if (!strcmp(env, rec.fName)) {
+                // can only force a level down, never past what the cpu supports
+                level = std::min(level, rec.fLevel);
+                found = true;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "G_CPU_LEVEL: unknown level '%s'\n", env);
+        }
+    }
+    return level;
+}
+
+GCPULevel GGetCPULevel() {
+    static const GCPULevel gLevel = compute_level();
+    return gLevel;
+}
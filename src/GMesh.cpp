@@ -0,0 +1,89 @@
+/*
+ *  Copyright 2024 Mike Reed
+ */
+
+#include "../include/GMesh.h"
+
+template <typename T>
+std::shared_ptr<GMesh> GMesh::Make(GMeshMode mode, int vertexCount, const GPoint verts[],
+                                   const GColor colors[], const GPoint texs[],
+                                   int indexCount, const T indices[]) {
+    if (vertexCount <= 0 || !verts) {
+        return nullptr;
+    }
+    if (!indices) {
+        indexCount = vertexCount;
+    }
+    auto index = [indices](int i) { return indices ? (int)indices[i] : i; };
+    for (int i = 0; i < indexCount; ++i) {
+        if (index(i) < 0 || index(i) >= vertexCount) {
+            return nullptr;
+        }
+    }
+
+    std::shared_ptr<GMesh> mesh(new GMesh);
+    mesh->fVerts.assign(verts, verts + vertexCount);
+    if (colors) {
+        mesh->fColors.assign(colors, colors + vertexCount);
+    }
+    if (texs) {
+        mesh->fTexs.assign(texs, texs + vertexCount);
+    }
+
+    // Strips and fans join with repeated indices, so skip triangles that have no area.
+    auto add_triangle = [&mesh](int i0, int i1, int i2) {
+        if (i0 != i1 && i1 != i2 && i2 != i0) {
+            mesh->fIndices.push_back(i0);
+            mesh->fIndices.push_back(i1);
+            mesh->fIndices.push_back(i2);
+        }
+    };
+    switch (mode) {
+        case GMeshMode::kTriangles:
+            for (int i = 2; i < indexCount; i += 3) {
+                add_triangle(index(i - 2), index(i - 1), index(i));
+            }
+            break;
+        case GMeshMode::kTriangleStrip:
+            for (int i = 2; i < indexCount; ++i) {
+                add_triangle(index(i - 2), index(i - 1), index(i));
+            }
+            break;
+        case GMeshMode::kTriangleFan:
+            for (int i = 2; i < indexCount; ++i) {
+                add_triangle(index(0), index(i - 1), index(i));
+            }
+            break;
+    }
+    return mesh;
+}
+
+std::shared_ptr<GMesh> GCreateMesh(GMeshMode mode, int vertexCount, const GPoint verts[],
+                                   const GColor colors[], const GPoint texs[],
+                                   int indexCount, const int indices[]) {
+    return GMesh::Make(mode, vertexCount, verts, colors, texs, indexCount, indices);
+}
+
+std::shared_ptr<GMesh> GCreateMesh(GMeshMode mode, int vertexCount, const GPoint verts[],
+                                   const GColor colors[], const GPoint texs[],
+                                   int indexCount, const uint16_t indices[]) {
+    return GMesh::Make(mode, vertexCount, verts, colors, texs, indexCount, indices);
+}
+
+void GMesh::draw(GCanvas* canvas, const GMatrix& matrix, const GPaint& paint) const {
+    const int count = this->countTriangles();
+    if (count == 0) {
+        return;
+    }
+    const GColor* colors = fColors.empty() ? nullptr : fColors.data();
+    const GPoint* texs = fTexs.empty() ? nullptr : fTexs.data();
+
+    if (matrix.isIdentity()) {
+        canvas->drawMesh(fVerts.data(), colors, texs, count, fIndices.data(), paint);
+        return;
+    }
+    canvas->save();
+    canvas->concat(matrix);
+    canvas->drawMesh(fVerts.data(), colors, texs, count, fIndices.data(), paint);
+    canvas->restore();
+}
@@ -5,6 +5,8 @@
 #include "../include/GPathBuilder.h"
 #include "../include/GMatrix.h"
 
+#include <algorithm>
+
 void GPathBuilder::reset() {
     fPts.clear();
     fVbs.clear();
@@ -36,8 +38,37 @@ void GPathBuilder::cubicTo(GPoint p1, GPoint p2, GPoint p3) {
     fVbs.push_back(GPathVerb::kCubic);
 }
 
+/**
+ *  Same as m.mapPoints(), but translate-only and scale+translate matrices get their own
+ *  (vectorizable) loops, rather than the general 6-multiply one.
+ */
+static void map_points(const GMatrix& m, GPoint dst[], const GPoint src[], int count) {
+    const float sx = m[0], sy = m[3], tx = m[4], ty = m[5];
+    switch (m.getType()) {
+        case GMatrix::kIdentity_Mask:
+            if (dst != src) {
+                std::copy(src, src + count, dst);
+            }
+            break;
+        case GMatrix::kTranslate_Mask:
+            for (int i = 0; i < count; ++i) {
+                dst[i] = { src[i].x + tx, src[i].y + ty };
+            }
+            break;
+        case GMatrix::kScale_Mask:
+        case GMatrix::kScale_Mask | GMatrix::kTranslate_Mask:
+            for (int i = 0; i < count; ++i) {
+                dst[i] = { src[i].x * sx + tx, src[i].y * sy + ty };
+            }
+            break;
+        default:
+            m.mapPoints(dst, src, count);
+            break;
+    }
+}
+
 void GPathBuilder::transform(const GMatrix& m) {
-    m.mapPoints(fPts.data(), fPts.size());
+    map_points(m, fPts.data(), fPts.data(), fPts.size());
 }
 
 std::shared_ptr<GPath> GPathBuilder::detach() {
@@ -48,17 +79,12 @@ std::shared_ptr<GPath> GPathBuilder::detach() {
 
 /////////////////////////////////////////////////////////////
 
-static bool is_identity(const GMatrix& m) {
-    return m[0] == 1 && m[3] == 1 &&
-           m[1] == 0 && m[2] == 0 && m[4] == 0 && m[5] == 0;
-}
-
 std::shared_ptr<GPath> GPath::transform(const GMatrix& m) const {
-    if (fPts.empty() || is_identity(m)) {
+    if (fPts.empty() || m.isIdentity()) {
         return const_cast<GPath*>(this)->shared_from_this();
     }
     std::vector<GPoint> dst(fPts.size());
-    m.mapPoints(dst.data(), fPts.data(), fPts.size());
+    map_points(m, dst.data(), fPts.data(), fPts.size());
     return std::make_shared<GPath>(std::move(dst), fVbs);
 }
 
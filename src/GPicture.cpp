@@ -0,0 +1,913 @@
+/*
+ *  Copyright 2024 Mike Reed
+ */
+
+#include "../include/GPicture.h"
+#include "../include/GPathBuilder.h"
+#include "../include/GShader.h"
+#include "../include/GTrace.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+static bool same_paint(const GPaint& a, const GPaint& b) {
+    return a.getColor() == b.getColor() &&
+           a.peekShader() == b.peekShader() &&
+           a.getBlendMode() == b.getBlendMode() &&
+           a.isAntiAlias() == b.isAntiAlias();
+}
+
+// Pinning device coordinates to +/- 2^30 keeps them (and a small outset) legal ints. NaN pins
+// to the low end.
+static float pin_coord(float x) {
+    return std::max(-1073741824.0f, std::min(x, 1073741824.0f));
+}
+
+static GRect pin_rect(const GRect& r) {
+    return GRect::LTRB(pin_coord(r.left), pin_coord(r.top), pin_coord(r.right),
+                       pin_coord(r.bottom));
+}
+
+// GPaths are immutable, so we share the caller's path, if a shared_ptr owns it. Otherwise (it
+// was constructed directly) we keep a copy.
+static std::shared_ptr<GPath> share_path(const GPath& path) {
+    if (auto shared = path.weak_from_this().lock()) {
+        return std::const_pointer_cast<GPath>(shared);
+    }
+    GPathBuilder builder;
+    GPath::Iter iter(path);
+    GPoint pts[GPath::kMaxNextPoints];
+    while (auto v = iter.next(pts)) {
+        switch (v.value()) {
+            case kMove:  builder.moveTo(pts[0]); break;
+            case kLine:  builder.lineTo(pts[1]); break;
+            case kQuad:  builder.quadTo(pts[1], pts[2]); break;
+            case kCubic: builder.cubicTo(pts[1], pts[2], pts[3]); break;
+        }
+    }
+    return builder.detach();
+}
+
+GRecordingCanvas::GRecordingCanvas() {
+    this->reset();
+}
+
+void GRecordingCanvas::newPicture() {
+    fPicture.reset(new GPicture);
+    fPicture->fMatrices.push_back(GMatrix());   // index 0 is always identity
+    fPicture->fClips.push_back({{0, 0, 0, 0}, false, -1});  // index 0 is always wide open
+}
+
+void GRecordingCanvas::reset() {
+    this->newPicture();
+
+    fStack.clear();
+    fStack.push_back({GMatrix(), 0});
+    fMatrixIndex = 0;
+}
+
+std::shared_ptr<GPicture> GRecordingCanvas::finishPicture(std::unique_ptr<GPicture> picture) {
+    const GPicture& recorded = *picture;
+    fLastSizes = {
+        recorded.fOps.size(), recorded.fMatrices.size(), recorded.fClips.size(),
+        recorded.fClipPaths.size(), recorded.fPaints.size(), recorded.fPoints.size(),
+        recorded.fColors.size(), recorded.fIndices.size(), recorded.fPaths.size(),
+    };
+    fReserveLastSizes = true;
+
+    picture->cullOccluded();
+    GSTATSCODE(fStats.fDrawsCulled += fLastSizes.ops - picture->fOps.size();)
+    picture->mergeRuns();
+    return std::shared_ptr<GPicture>(picture.release());
+}
+
+std::shared_ptr<GPicture> GRecordingCanvas::detach() {
+    GTRACE("GRecordingCanvas::detach");
+    std::shared_ptr<GPicture> picture = this->finishPicture(std::move(fPicture));
+    this->reset();
+    return picture;
+}
+
+std::shared_ptr<GPicture> GRecordingCanvas::detachDraws() {
+    GTRACE("GRecordingCanvas::detachDraws");
+    std::unique_ptr<GPicture> prev = std::move(fPicture);
+    this->newPicture();
+
+    // Copy the clip of each saved state (levels often share one, so each is copied once).
+    std::vector<int> clips(prev->fClips.size(), -1);
+    std::vector<int> clipPaths(prev->fClipPaths.size(), -1);
+    clips[0] = 0;
+    for (State& state : fStack) {
+        state.fClip = this->copyClip(*prev, state.fClip, &clips, &clipPaths);
+    }
+    fMatrixIndex = -1;  // the CTM is kept, but not its index
+    return this->finishPicture(std::move(prev));
+}
+
+// Returns the index in fPicture of src's clip, copying it (and the path clips it refers to, that
+// have not been copied yet) on first use. clips and clipPaths map src's indices to ours, or -1.
+int GRecordingCanvas::copyClip(const GPicture& src, int index, std::vector<int>* clips,
+                               std::vector<int>* clipPaths) {
+    if ((*clips)[index] >= 0) {
+        return (*clips)[index];
+    }
+    GPicture& dst = *fPicture;
+    GPicture::Clip clip = src.fClips[index];
+
+    // walk back to the newest path clip we already have, then copy the newer ones, oldest first
+    std::vector<int> chain;
+    int prev = clip.paths;
+    for (; prev >= 0 && (*clipPaths)[prev] < 0; prev = src.fClipPaths[prev].prev) {
+        chain.push_back(prev);
+    }
+    prev = prev >= 0 ? (*clipPaths)[prev] : -1;
+    for (auto i = chain.rbegin(); i != chain.rend(); ++i) {
+        dst.fClipPaths.push_back({(int)dst.fPaths.size(), prev});
+        dst.fPaths.push_back(src.fPaths[src.fClipPaths[*i].path]);
+        prev = (*clipPaths)[*i] = (int)dst.fClipPaths.size() - 1;
+    }
+    clip.paths = prev;
+
+    (*clips)[index] = (int)dst.fClips.size();
+    dst.fClips.push_back(clip);
+    return (*clips)[index];
+}
+
+// The next recording is usually another frame of the same scene, so once it starts, size our
+// arrays for that up front, rather than growing them (and reallocating) draw by draw. This waits
+// for a draw, as many recorders (e.g. the deferred canvas) are never used again after detaching.
+void GRecordingCanvas::reserveLastSizes() {
+    fReserveLastSizes = false;
+    GPicture& pic = *fPicture;
+    pic.fOps.reserve(fLastSizes.ops);
+    pic.fMatrices.reserve(fLastSizes.matrices);
+    pic.fClips.reserve(fLastSizes.clips);
+    pic.fClipPaths.reserve(fLastSizes.clipPaths);
+    pic.fPaints.reserve(fLastSizes.paints);
+    pic.fPoints.reserve(fLastSizes.points);
+    pic.fColors.reserve(fLastSizes.colors);
+    pic.fIndices.reserve(fLastSizes.indices);
+    pic.fPaths.reserve(fLastSizes.paths);
+}
+
+void GRecordingCanvas::save() {
+    fStack.push_back(fStack.back());
+}
+
+void GRecordingCanvas::restore() {
+    assert(fStack.size() > 1);
+    fStack.pop_back();
+    fMatrixIndex = -1;
+}
+
+void GRecordingCanvas::concat(const GMatrix& m) {
+    if (m.isIdentity()) {
+        return;
+    }
+    fStack.back().fCTM = GMatrix::Concat(fStack.back().fCTM, m);
+    fMatrixIndex = -1;
+}
+
+void GRecordingCanvas::addClip(const GPicture::Clip& clip) {
+    if (fReserveLastSizes) {
+        this->reserveLastSizes();
+    }
+    fStack.back().fClip = (int)fPicture->fClips.size();
+    fPicture->fClips.push_back(clip);
+}
+
+void GRecordingCanvas::clipRect(const GRect& r) {
+    GMatrix& ctm = fStack.back().fCTM;
+    GPoint pts[4] = {{r.left, r.top}, {r.right, r.top}, {r.right, r.bottom}, {r.left, r.bottom}};
+    if (!ctm.isScaleTranslate()) {
+        // rotated or skewed, so it is no longer a rect
+        GPathBuilder builder;
+        builder.addPolygon(pts, 4);
+        this->clipPath(*builder.detach());
+        return;
+    }
+    ctm.mapPoints(pts, 4);
+
+    // Rect clips are kept in picture-space, and just intersect with each other.
+    GPicture::Clip clip = fPicture->fClips[fStack.back().fClip];
+    GRect dev = pin_rect(GRect::LTRB(std::min(pts[0].x, pts[2].x), std::min(pts[0].y, pts[2].y),
+                                     std::max(pts[0].x, pts[2].x), std::max(pts[0].y, pts[2].y)));
+    if (clip.hasRect) {
+        dev = GRect::LTRB(std::max(dev.left, clip.rect.left), std::max(dev.top, clip.rect.top),
+                          std::min(dev.right, clip.rect.right),
+                          std::min(dev.bottom, clip.rect.bottom));
+        if (dev.isEmpty()) {
+            dev = {0, 0, 0, 0};
+        }
+    }
+    clip.rect = dev;
+    clip.hasRect = true;
+    this->addClip(clip);
+}
+
+void GRecordingCanvas::clipPath(const GPath& path) {
+    GPicture& pic = *fPicture;
+    GPicture::Clip clip = pic.fClips[fStack.back().fClip];
+
+    pic.fClipPaths.push_back({(int)pic.fPaths.size(), clip.paths});
+    pic.fPaths.push_back(share_path(path)->transform(fStack.back().fCTM));
+    clip.paths = (int)pic.fClipPaths.size() - 1;
+    this->addClip(clip);
+}
+
+GPicture::Op& GRecordingCanvas::addOp(GPicture::OpType type, const GPaint& paint) {
+    if (fReserveLastSizes) {
+        this->reserveLastSizes();
+    }
+    auto& matrices = fPicture->fMatrices;
+    if (fMatrixIndex < 0) {
+        // Chains of concats (and save/restore pairs that cancel) collapse into one matrix.
+        GMatrix& ctm = fStack.back().fCTM;
+        if (ctm.isIdentity()) {
+            fMatrixIndex = 0;
+        } else if (ctm == matrices.back()) {
+            fMatrixIndex = (int)matrices.size() - 1;
+        } else {
+            fMatrixIndex = (int)matrices.size();
+            matrices.push_back(ctm);
+        }
+    }
+
+    auto& paints = fPicture->fPaints;
+    if (paints.empty() || !same_paint(paints.back(), paint)) {
+        paints.push_back(paint);
+    }
+
+    GPicture::Op op;
+    op.type = type;
+    op.flags = 0;
+    op.matrix = fMatrixIndex;
+    op.clip = fStack.back().fClip;
+    op.paint = (int)paints.size() - 1;
+    op.data = 0;
+    op.count = 0;
+    fPicture->fOps.push_back(op);
+    return fPicture->fOps.back();
+}
+
+void GRecordingCanvas::clear(const GColor& color) {
+    if (fReserveLastSizes) {
+        this->reserveLastSizes();
+    }
+    // clear() ignores the CTM, so it does not need a matrix
+    GPicture::Op op;
+    op.type = GPicture::OpType::kClear;
+    op.flags = 0;
+    op.matrix = 0;
+    op.clip = fStack.back().fClip;
+    op.paint = (int)fPicture->fColors.size();
+    op.data = 0;
+    op.count = 0;
+    fPicture->fColors.push_back(color);
+    fPicture->fOps.push_back(op);
+    GSTATSCODE(fStats.fDraws[GCanvasStats::kClear_DrawType] += 1;)
+}
+
+void GRecordingCanvas::drawRect(const GRect& r, const GPaint& paint) {
+    GSTATSCODE(fStats.fDraws[GCanvasStats::kRect_DrawType] += 1;)
+    auto& op = this->addOp(GPicture::OpType::kRect, paint);
+    op.data = (int)fPicture->fPoints.size();
+    op.count = 2;
+    fPicture->fPoints.push_back({r.left, r.top});
+    fPicture->fPoints.push_back({r.right, r.bottom});
+}
+
+void GRecordingCanvas::drawConvexPolygon(const GPoint pts[], int count, const GPaint& paint) {
+    GSTATSCODE(fStats.fDraws[GCanvasStats::kConvexPolygon_DrawType] += 1;)
+    if (count < 3) {
+        return;
+    }
+    auto& op = this->addOp(GPicture::OpType::kConvexPolygon, paint);
+    op.data = (int)fPicture->fPoints.size();
+    op.count = count;
+    fPicture->fPoints.insert(fPicture->fPoints.end(), pts, pts + count);
+}
+
+void GRecordingCanvas::drawPath(const GPath& path, const GPaint& paint) {
+    GSTATSCODE(fStats.fDraws[GCanvasStats::kPath_DrawType] += 1;)
+    auto& op = this->addOp(GPicture::OpType::kPath, paint);
+    op.data = (int)fPicture->fPaths.size();
+    fPicture->fPaths.push_back(share_path(path));
+}
+
+void GRecordingCanvas::drawMesh(const GPoint verts[], const GColor colors[], const GPoint texs[],
+                                int count, const int indices[], const GPaint& paint) {
+    GSTATSCODE(fStats.fDraws[GCanvasStats::kMesh_DrawType] += 1;)
+    if (count <= 0) {
+        return;
+    }
+    const int n = count * 3;
+    int vertCount = 0;
+    for (int i = 0; i < n; ++i) {
+        vertCount = std::max(vertCount, indices[i] + 1);
+    }
+    if (!paint.peekShader()) {
+        texs = nullptr;
+    }
+
+    auto& op = this->addOp(GPicture::OpType::kMesh, paint);
+    op.count = count;
+
+    // fIndices holds the triangle indices, followed by the offsets to our verts, colors and
+    // texs (if present) in fPoints and fColors.
+    auto& pic = *fPicture;
+    op.data = (int)pic.fIndices.size();
+    pic.fIndices.insert(pic.fIndices.end(), indices, indices + n);
+    pic.fIndices.push_back((int)pic.fPoints.size());
+    pic.fPoints.insert(pic.fPoints.end(), verts, verts + vertCount);
+    if (colors) {
+        op.flags |= GPicture::kHasColors_MeshFlag;
+        pic.fIndices.push_back((int)pic.fColors.size());
+        pic.fColors.insert(pic.fColors.end(), colors, colors + vertCount);
+    }
+    if (texs) {
+        op.flags |= GPicture::kHasTexs_MeshFlag;
+        pic.fIndices.push_back((int)pic.fPoints.size());
+        pic.fPoints.insert(pic.fPoints.end(), texs, texs + vertCount);
+    }
+}
+
+void GRecordingCanvas::drawQuad(const GPoint verts[4], const GColor colors[4],
+                                const GPoint texs[4], int level, const GPaint& paint) {
+    GSTATSCODE(fStats.fDraws[GCanvasStats::kQuad_DrawType] += 1;)
+    if (!paint.peekShader()) {
+        texs = nullptr;
+    }
+
+    auto& op = this->addOp(GPicture::OpType::kQuad, paint);
+    op.count = level;
+
+    // same layout as drawMesh, but without the triangle indices
+    auto& pic = *fPicture;
+    op.data = (int)pic.fIndices.size();
+    pic.fIndices.push_back((int)pic.fPoints.size());
+    pic.fPoints.insert(pic.fPoints.end(), verts, verts + 4);
+    if (colors) {
+        op.flags |= GPicture::kHasColors_MeshFlag;
+        pic.fIndices.push_back((int)pic.fColors.size());
+        pic.fColors.insert(pic.fColors.end(), colors, colors + 4);
+    }
+    if (texs) {
+        op.flags |= GPicture::kHasTexs_MeshFlag;
+        pic.fIndices.push_back((int)pic.fPoints.size());
+        pic.fPoints.insert(pic.fPoints.end(), texs, texs + 4);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Bounds the cost of testing each op against the occluders
+static constexpr int kMaxOccluders = 32;
+
+static int64_t area(const GIRect& r) {
+    return ((int64_t)r.right - r.left) * ((int64_t)r.bottom - r.top);
+}
+
+static bool contains(const GIRect& outer, const GIRect& inner) {
+    return outer.left <= inner.left && outer.top <= inner.top &&
+           outer.right >= inner.right && outer.bottom >= inner.bottom;
+}
+
+/*
+ *  Returns true if op replaces every pixel it touches, regardless of what was there before,
+ *  and is an axis-aligned rect (or a clear). If so, covered is set to the pixels it is sure
+ *  to touch.
+ */
+bool GPicture::isOpaqueRect(const Op& op, GIRect* covered) const {
+    const Clip& clip = fClips[op.clip];
+    if (clip.paths >= 0) {
+        return false;   // we don't know which pixels a path clip leaves
+    }
+
+    GRect rect;
+    if (op.type == OpType::kClear) {
+        if (!clip.hasRect) {
+            *covered = GIRect::LTRB(INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX);
+            return true;
+        }
+        rect = clip.rect;
+    } else {
+        if (op.type != OpType::kRect) {
+            return false;
+        }
+        const GMatrix& m = fMatrices[op.matrix];
+        if (!m.isScaleTranslate()) {
+            return false;
+        }
+
+        const GPaint& paint = fPaints[op.paint];
+        GShader* shader = paint.peekShader();
+        switch (paint.getBlendMode()) {
+            case GBlendMode::kClear:
+            case GBlendMode::kSrc:
+                break;
+            case GBlendMode::kSrcOver:
+                if (shader ? !shader->isOpaque() : paint.getAlpha() < 1) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+
+        GPoint pts[2] = { fPoints[op.data], fPoints[op.data + 1] };
+        m.mapPoints(pts, 2);
+        rect = GRect::LTRB(std::min(pts[0].x, pts[1].x), std::min(pts[0].y, pts[1].y),
+                           std::max(pts[0].x, pts[1].x), std::max(pts[0].y, pts[1].y));
+        if (clip.hasRect) {
+            rect = GRect::LTRB(std::max(rect.left, clip.rect.left),
+                               std::max(rect.top, clip.rect.top),
+                               std::min(rect.right, clip.rect.right),
+                               std::min(rect.bottom, clip.rect.bottom));
+        }
+    }
+
+    const float l = rect.left, t = rect.top, r = rect.right, b = rect.bottom;
+    if (!(l > -1e9f && t > -1e9f && r < 1e9f && b < 1e9f)) {
+        return false;   // huge, or NaN
+    }
+    // only the pixels that lie entirely inside the rect
+    *covered = GIRect::LTRB(GCeilToInt(l), GCeilToInt(t), GFloorToInt(r), GFloorToInt(b));
+    return !covered->isEmpty();
+}
+
+void GPicture::cullOccluded() {
+    std::vector<GIRect> occluders;
+
+    // Walk backwards, so that each op is tested against everything drawn after it. The ops we
+    // keep are compacted (in place) towards the end of fOps.
+    int keep = (int)fOps.size();
+    for (int i = keep - 1; i >= 0; --i) {
+        const Op& op = fOps[i];
+        const GIRect bounds = this->clippedBounds(op);
+        if (bounds.isEmpty()) {
+            continue;   // clipped out
+        }
+        if (std::any_of(occluders.begin(), occluders.end(),
+                        [&bounds](const GIRect& o) { return contains(o, bounds); })) {
+            continue;
+        }
+        fOps[--keep] = op;
+
+        if (op.type == OpType::kClear && op.clip == 0) {
+            break;  // clear() replaces every pixel, so nothing before it can be seen
+        }
+        GIRect covered;
+        if (this->isOpaqueRect(op, &covered)) {
+            if ((int)occluders.size() < kMaxOccluders) {
+                occluders.push_back(covered);
+            } else {
+                auto smallest = std::min_element(occluders.begin(), occluders.end(),
+                                   [](const GIRect& a, const GIRect& b) {
+                                       return area(a) < area(b);
+                                   });
+                if (area(*smallest) < area(covered)) {
+                    *smallest = covered;
+                }
+            }
+        }
+    }
+    fOps.erase(fOps.begin(), fOps.begin() + keep);
+}
+
+// Bounds the cost of the overlap test, and the number of edges in a merged path
+static constexpr int kMaxMergeCount = 256;
+
+// Tiled playback (and merging, which keeps each run inside one tile)
+static constexpr int kTileSize = 256;
+
+// Returns the range of tiles (inclusive) touched by the device bounds. Like playback, this
+// folds everything left of (or above) the origin into the first tile.
+static GIRect tile_range(const GIRect& r) {
+    auto tile = [](int v) { return std::max(v, 0) / kTileSize; };
+    return GIRect::LTRB(tile(r.left), tile(r.top), tile(r.right), tile(r.bottom));
+}
+
+static GRect point_bounds(const GPoint pts[], int count) {
+    GRect r = {pts[0].x, pts[0].y, pts[0].x, pts[0].y};
+    for (int i = 1; i < count; ++i) {
+        r.left   = std::min(r.left,   pts[i].x);
+        r.top    = std::min(r.top,    pts[i].y);
+        r.right  = std::max(r.right,  pts[i].x);
+        r.bottom = std::max(r.bottom, pts[i].y);
+    }
+    return r;
+}
+
+static bool rects_overlap(const GRect& a, const GRect& b) {
+    // touching edges are fine, as no pixel center can be contained by both
+    return a.left < b.right && b.left < a.right && a.top < b.bottom && b.top < a.bottom;
+}
+
+void GPicture::mergeRuns() {
+    auto is_mergeable = [this](const Op& op) {
+        if (fPaints[op.paint].isAntiAlias()) {
+            // shapes that share an edge each get partial coverage there, which a merged path
+            // would not (and AA does not apply to drawRect at all)
+            return false;
+        }
+        if (op.type == OpType::kRect) {
+            const GPoint* p = &fPoints[op.data];
+            return p[0].x < p[1].x && p[0].y < p[1].y;  // skip empty or inverted rects
+        }
+        return op.type == OpType::kConvexPolygon;
+    };
+    auto op_points = [this](const Op& op, GPoint storage[4]) -> const GPoint* {
+        if (op.type == OpType::kRect) {
+            const GPoint* p = &fPoints[op.data];
+            storage[0] = p[0];
+            storage[1] = {p[1].x, p[0].y};
+            storage[2] = p[1];
+            storage[3] = {p[0].x, p[1].y};
+            return storage;
+        }
+        return &fPoints[op.data];
+    };
+    auto op_count = [](const Op& op) { return op.type == OpType::kRect ? 4 : op.count; };
+
+    std::vector<GRect> runBounds;
+    GPathBuilder builder;
+    GPoint storage[4];
+
+    // Runs only ever shrink, so we compact in place: keep <= i.
+    const int n = (int)fOps.size();
+    int keep = 0;
+    for (int i = 0; i < n;) {
+        const Op first = fOps[i];
+        if (!is_mergeable(first)) {
+            fOps[keep++] = first;
+            i += 1;
+            continue;
+        }
+
+        // Extend the run while the ops share paint and matrix, and don't overlap (so the
+        // order they are drawn in does not matter, and no pixel is blended twice).
+        //
+        // Tiled playback bins a merged path by its union bounds, and every tile it lands in
+        // rasterizes all of its edges, so a run must also stay inside a single tile.
+        const GIRect tiles = tile_range(this->clippedBounds(first));
+        const bool oneTile = tiles.left == tiles.right && tiles.top == tiles.bottom;
+        runBounds.clear();
+        runBounds.push_back(point_bounds(op_points(first, storage), op_count(first)));
+        int end = i + 1;
+        for (; oneTile && end < n && end - i < kMaxMergeCount; ++end) {
+            const Op& op = fOps[end];
+            if (!is_mergeable(op) || op.paint != first.paint || op.matrix != first.matrix ||
+                op.clip != first.clip) {
+                break;
+            }
+            const GIRect t = tile_range(this->clippedBounds(op));
+            if (t.left != tiles.left || t.top != tiles.top || t.right != tiles.right ||
+                t.bottom != tiles.bottom) {
+                break;
+            }
+            const GRect r = point_bounds(op_points(op, storage), op_count(op));
+            if (std::any_of(runBounds.begin(), runBounds.end(),
+                            [&r](const GRect& b) { return rects_overlap(r, b); })) {
+                break;
+            }
+            runBounds.push_back(r);
+        }
+
+        if (end - i == 1) {
+            fOps[keep++] = first;
+        } else {
+            for (int j = i; j < end; ++j) {
+                const GPoint* pts = op_points(fOps[j], storage);
+                builder.moveTo(pts[0]);
+                for (int k = 1; k < op_count(fOps[j]); ++k) {
+                    builder.lineTo(pts[k]);
+                }
+            }
+            Op op = first;
+            op.type = OpType::kPath;
+            op.data = (int)fPaths.size();
+            op.count = end - i;
+            fPaths.push_back(builder.detach());
+            fOps[keep++] = op;
+        }
+        i = end;
+    }
+    fOps.resize(keep);
+}
+
+void GPicture::applyClip(GCanvas* canvas, int index) const {
+    const Clip& clip = fClips[index];
+    if (clip.hasRect) {
+        canvas->clipRect(clip.rect);
+    }
+    for (int i = clip.paths; i >= 0; i = fClipPaths[i].prev) {
+        canvas->clipPath(*fPaths[fClipPaths[i].path]);
+    }
+}
+
+void GPicture::drawOp(GCanvas* canvas, const Op& op, State* state) const {
+    const bool usesMatrix = op.type != OpType::kClear;
+    if (op.clip != state->clip || (usesMatrix && op.matrix != state->matrix)) {
+        // The canvas is inside our save(), so restore() takes it back to our identity (and
+        // the canvas' own clip).
+        canvas->restore();
+        canvas->save();
+        this->applyClip(canvas, op.clip);
+        state->clip = op.clip;
+        state->matrix = 0;
+        if (usesMatrix && op.matrix != 0) {
+            canvas->concat(fMatrices[op.matrix]);
+            state->matrix = op.matrix;
+        }
+    }
+    if (op.type == OpType::kClear) {
+        canvas->clear(fColors[op.paint]);
+        return;
+    }
+
+    const GPaint& paint = fPaints[op.paint];
+    const GPoint* pts = fPoints.data();
+    switch (op.type) {
+        case OpType::kRect:
+            canvas->drawRect(GRect::LTRB(pts[op.data].x, pts[op.data].y,
+                                         pts[op.data + 1].x, pts[op.data + 1].y), paint);
+            break;
+        case OpType::kConvexPolygon:
+            canvas->drawConvexPolygon(pts + op.data, op.count, paint);
+            break;
+        case OpType::kPath:
+            canvas->drawPath(*fPaths[op.data], paint);
+            break;
+        case OpType::kMesh:
+        case OpType::kQuad: {
+            const bool isMesh = op.type == OpType::kMesh;
+            const int* offsets = &fIndices[op.data + (isMesh ? op.count * 3 : 0)];
+            const GPoint* verts = pts + *offsets++;
+            const GColor* colors = nullptr;
+            const GPoint* texs = nullptr;
+            if (op.flags & kHasColors_MeshFlag) {
+                colors = &fColors[*offsets++];
+            }
+            if (op.flags & kHasTexs_MeshFlag) {
+                texs = pts + *offsets++;
+            }
+            if (isMesh) {
+                canvas->drawMesh(verts, colors, texs, op.count, &fIndices[op.data], paint);
+            } else {
+                canvas->drawQuad(verts, colors, texs, op.count, paint);
+            }
+        } break;
+        case OpType::kClear:
+            break;
+    }
+}
+
+void GPicture::playback(GCanvas* canvas) const {
+    State state = {0, 0};   // the canvas' CTM and clip are our identity and wide open
+
+    canvas->save();
+    for (const Op& op : fOps) {
+        this->drawOp(canvas, op, &state);
+    }
+    canvas->restore();
+}
+
+// Device bounds are conservative (outset), so a draw that touches no pixel of the cull rect
+// can be skipped without changing the result.
+static bool misses(const GIRect& bounds, const GIRect& cull) {
+    return bounds.isEmpty() || bounds.right < cull.left || bounds.bottom < cull.top ||
+           bounds.left >= cull.right || bounds.top >= cull.bottom;
+}
+
+void GPicture::playback(GCanvas* canvas, const GRect& cullRect) const {
+    const GIRect cull = pin_rect(cullRect).roundOut();
+    State state = {0, 0};
+
+    canvas->save();
+    for (const Op& op : fOps) {
+        if (!misses(this->clippedBounds(op), cull)) {
+            this->drawOp(canvas, op, &state);
+        }
+    }
+    canvas->restore();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+GIRect GPicture::deviceBounds(const Op& op) const {
+    GPoint storage[4];
+    const GPoint* pts = storage;
+    int count = 0;
+
+    switch (op.type) {
+        case OpType::kClear:
+            return GIRect::LTRB(INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX);
+        case OpType::kRect: {
+            const GPoint* p = &fPoints[op.data];
+            storage[0] = p[0];
+            storage[1] = {p[1].x, p[0].y};
+            storage[2] = p[1];
+            storage[3] = {p[0].x, p[1].y};
+            count = 4;
+        } break;
+        case OpType::kConvexPolygon:
+            pts = &fPoints[op.data];
+            count = op.count;
+            break;
+        case OpType::kPath: {
+            const GRect r = fPaths[op.data]->bounds();
+            storage[0] = {r.left, r.top};
+            storage[1] = {r.right, r.top};
+            storage[2] = {r.right, r.bottom};
+            storage[3] = {r.left, r.bottom};
+            count = 4;
+        } break;
+        case OpType::kMesh:
+        case OpType::kQuad:
+            // the triangles (and any tesselation of the quad) lie inside the hull of the verts
+            if (op.type == OpType::kMesh) {
+                const int* indices = &fIndices[op.data];
+                const GPoint* verts = &fPoints[indices[op.count * 3]];
+                int maxIndex = 0;
+                for (int i = 0; i < op.count * 3; ++i) {
+                    maxIndex = std::max(maxIndex, indices[i]);
+                }
+                pts = verts;
+                count = maxIndex + 1;
+            } else {
+                pts = &fPoints[fIndices[op.data]];
+                count = 4;
+            }
+            break;
+    }
+
+    const GMatrix& m = fMatrices[op.matrix];
+    float l = FLT_MAX, t = FLT_MAX, r = -FLT_MAX, b = -FLT_MAX;
+    for (int i = 0; i < count; ++i) {
+        const GPoint p = m * pts[i];
+        l = std::min(l, p.x);
+        t = std::min(t, p.y);
+        r = std::max(r, p.x);
+        b = std::max(b, p.y);
+    }
+    if (!(l <= r && t <= b)) {
+        return GIRect::LTRB(0, 0, 0, 0);    // no points, or NaNs
+    }
+    // the outset of 1 covers rounding
+    return GIRect::LTRB(GFloorToInt(pin_coord(l)) - 1, GFloorToInt(pin_coord(t)) - 1,
+                        GCeilToInt(pin_coord(r)) + 1, GCeilToInt(pin_coord(b)) + 1);
+}
+
+GIRect GPicture::clippedBounds(const Op& op) const {
+    GIRect r = this->deviceBounds(op);
+    const Clip& clip = fClips[op.clip];
+    if (clip.hasRect) {
+        const GIRect c = pin_rect(clip.rect).roundOut();
+        r = GIRect::LTRB(std::max(r.left, c.left - 1), std::max(r.top, c.top - 1),
+                         std::min(r.right, c.right + 1), std::min(r.bottom, c.bottom + 1));
+        if (r.isEmpty()) {
+            r = GIRect::LTRB(0, 0, 0, 0);
+        }
+    }
+    return r;
+}
+
+void GPicture::playback(const GBitmap& bitmap, int threadCount, GCanvasStats* stats) const {
+    GTRACE("GPicture::playback");
+    const int w = bitmap.width();
+    const int h = bitmap.height();
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+    if (threadCount <= 1) {
+        if (auto canvas = GCreateCanvas(bitmap)) {
+            this->playback(canvas.get(), GRect::WH((float)w, (float)h));
+            GSTATSCODE(if (stats) { *stats += canvas->getStats(); })
+        }
+        return;
+    }
+    const int tilesX = (w + kTileSize - 1) / kTileSize;
+    const int tilesY = (h + kTileSize - 1) / kTileSize;
+
+    // bin each op into every tile that its device bounds touch
+    std::vector<std::vector<int>> bins(tilesX * tilesY);
+    for (int i = 0; i < (int)fOps.size(); ++i) {
+        const GIRect r = this->clippedBounds(fOps[i]);
+        if (misses(r, GIRect::WH(w, h))) {
+            continue;
+        }
+        const int x0 = std::max(r.left, 0) / kTileSize;
+        const int y0 = std::max(r.top, 0) / kTileSize;
+        const int x1 = std::min(r.right, w - 1) / kTileSize;
+        const int y1 = std::min(r.bottom, h - 1) / kTileSize;
+        for (int ty = y0; ty <= y1; ++ty) {
+            for (int tx = x0; tx <= x1; ++tx) {
+                bins[ty * tilesX + tx].push_back(i);
+            }
+        }
+    }
+
+    std::mutex shaderMutex;
+    std::atomic<int> nextTile(0);
+    GSTATSCODE(std::mutex statsMutex;)
+
+    auto worker = [&]() {
+        GSTATSCODE(GCanvasStats tileStats;)
+        for (int tile; (tile = nextTile++) < (int)bins.size();) {
+            const auto& ops = bins[tile];
+            if (ops.empty()) {
+                continue;
+            }
+            GTRACE("GPicture::tile");
+            const int x = (tile % tilesX) * kTileSize;
+            const int y = (tile / tilesX) * kTileSize;
+
+            // Clipping (rather than translating into a smaller bitmap) leaves the device
+            // coordinates untouched, so each pixel comes out exactly as in a single canvas.
+            auto canvas = GCreateCanvas(bitmap);
+            if (!canvas) {
+                continue;
+            }
+            canvas->clipRect(GRect::XYWH((float)x, (float)y, kTileSize, kTileSize));
+
+            State state = {0, 0};
+            canvas->save();
+            for (int index : ops) {
+                const Op& op = fOps[index];
+                if (op.type != OpType::kClear && fPaints[op.paint].peekShader()) {
+                    std::lock_guard<std::mutex> lock(shaderMutex);
+                    this->drawOp(canvas.get(), op, &state);
+                } else {
+                    this->drawOp(canvas.get(), op, &state);
+                }
+            }
+            canvas->restore();
+            GSTATSCODE(tileStats += canvas->getStats();)
+        }
+        GSTATSCODE(if (stats) {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            *stats += tileStats;
+        })
+    };
+
+    threadCount = std::max(1, std::min(threadCount, (int)bins.size()));
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threadCount; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+class GDeferredCanvas : public GRecordingCanvas {
+public:
+    GDeferredCanvas(const GBitmap& bitmap, int threadCount)
+        : fBitmap(bitmap), fThreadCount(threadCount) {}
+
+    ~GDeferredCanvas() override {
+        this->finish();
+    }
+
+    void finish() override {
+        GCanvasStats* stats = nullptr;
+        GSTATSCODE(stats = &fRasterStats;)
+        this->detachDraws()->playback(fBitmap, fThreadCount, stats);
+
+        // Playback draws an op once for each tile it touches (and merged runs as paths), so
+        // our draw counts stay the calls made on us: just keep the raster counters.
+        GSTATSCODE(std::fill_n(fRasterStats.fDraws, GCanvasStats::kDrawTypeCount, 0);)
+        GSTATSCODE(fRasterStats.fDrawsCulled = 0;)
+    }
+
+    GCanvasStats getStats() const override {
+        GCanvasStats stats = GRecordingCanvas::getStats();
+        GSTATSCODE(stats += fRasterStats;)
+        return stats;
+    }
+
+    void resetStats() override {
+        GRecordingCanvas::resetStats();
+        GSTATSCODE(fRasterStats = GCanvasStats();)
+    }
+
+private:
+    const GBitmap fBitmap;
+    const int     fThreadCount;
+    GSTATSCODE(GCanvasStats fRasterStats;)   // spans, pixels, etc. from playback
+};
+
+std::unique_ptr<GCanvas> GCreateCanvas(const GBitmap& bitmap, int threadCount) {
+    if (threadCount <= 0) {
+        return GCreateCanvas(bitmap);
+    }
+    if (bitmap.width() <= 0 || bitmap.height() <= 0 || !bitmap.pixels()) {
+        return nullptr;
+    }
+    return std::unique_ptr<GCanvas>(new GDeferredCanvas(bitmap, threadCount));
+}
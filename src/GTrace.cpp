@@ -0,0 +1,186 @@
+/*
+ *  Copyright 2024 Mike Reed
+ */
+
+#include "../include/GTrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+
+namespace {
+
+struct Event {
+    const char* fName;
+    int64_t     fStartNS;
+    int64_t     fDurationNS;
+    int         fThread;
+};
+
+std::atomic<bool>  gEnabled(false);
+std::mutex         gMutex;          // guards gEvents
+std::vector<Event> gEvents;
+
+int64_t now_ns() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Small, stable ids read better on the timeline than std::thread::id hashes.
+int this_thread_id() {
+    static std::atomic<int> gNextID(1);
+    thread_local int id = gNextID++;
+    return id;
+}
+
+// Names come from callers (e.g. an image's title), so escape what JSON does not allow in a string.
+void write_json_string(FILE* f, const char str[]) {
+    fputc('"', f);
+    for (; *str; ++str) {
+        const unsigned char c = *str;
+        if (c == '"' || c == '\\') {
+            fprintf(f, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+}  // namespace
+
+void GTraceStart() {
+    std::lock_guard<std::mutex> lock(gMutex);
+    gEvents.clear();
+    gEnabled = true;
+}
+
+bool GTraceIsEnabled() {
+    return gEnabled.load(std::memory_order_relaxed);
+}
+
+bool GTraceStopAndWrite(const char path[]) {
+    std::lock_guard<std::mutex> lock(gMutex);
+    gEnabled = false;
+
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    // events are added as they end, so find the earliest start
+    int64_t origin = INT64_MAX;
+    for (const Event& e : gEvents) {
+        origin = std::min(origin, e.fStartNS);
+    }
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < gEvents.size(); ++i) {
+        const Event& e = gEvents[i];
+        // complete ("X") events, timestamps in microseconds
+        fprintf(f, "{\"name\":");
+        write_json_string(f, e.fName);
+        fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+                e.fThread, (e.fStartNS - origin) * 1e-3, e.fDurationNS * 1e-3,
+                i + 1 < gEvents.size() ? "," : "");
+    }
+    fprintf(f, "],\"displayTimeUnit\":\"ms\"}\n");
+    gEvents.clear();
+    return fclose(f) == 0;
+}
+
+GTraceScope::GTraceScope(const char name[]) : fName(nullptr), fStartNS(0) {
+    if (GTraceIsEnabled()) {
+        fName = name;
+        fStartNS = now_ns();
+    }
+}
+
+GTraceScope::~GTraceScope() {
+    if (fName) {
+        const Event e = { fName, fStartNS, now_ns() - fStartNS, this_thread_id() };
+        std::lock_guard<std::mutex> lock(gMutex);
+        if (gEnabled) {
+            gEvents.push_back(e);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+class GTraceCanvas : public GCanvas {
+public:
+    GTraceCanvas(std::unique_ptr<GCanvas> canvas) : fCanvas(std::move(canvas)) {}
+
+    ~GTraceCanvas() override {
+        GTRACE("GCanvas::~GCanvas");    // e.g. a deferred canvas rasterizes here
+        fCanvas.reset();
+    }
+
+    void save() override {
+        GTRACE("GCanvas::save");
+        fCanvas->save();
+    }
+    void restore() override {
+        GTRACE("GCanvas::restore");
+        fCanvas->restore();
+    }
+    void concat(const GMatrix& m) override {
+        GTRACE("GCanvas::concat");
+        fCanvas->concat(m);
+    }
+    void clipRect(const GRect& r) override {
+        GTRACE("GCanvas::clipRect");
+        fCanvas->clipRect(r);
+    }
+    void clipPath(const GPath& path) override {
+        GTRACE("GCanvas::clipPath");
+        fCanvas->clipPath(path);
+    }
+    void clear(const GColor& color) override {
+        GTRACE("GCanvas::clear");
+        fCanvas->clear(color);
+    }
+    void drawRect(const GRect& r, const GPaint& paint) override {
+        GTRACE("GCanvas::drawRect");
+        fCanvas->drawRect(r, paint);
+    }
+    void drawConvexPolygon(const GPoint pts[], int count, const GPaint& paint) override {
+        GTRACE("GCanvas::drawConvexPolygon");
+        fCanvas->drawConvexPolygon(pts, count, paint);
+    }
+    void drawPath(const GPath& path, const GPaint& paint) override {
+        GTRACE("GCanvas::drawPath");
+        fCanvas->drawPath(path, paint);
+    }
+    void drawMesh(const GPoint verts[], const GColor colors[], const GPoint texs[],
+                  int count, const int indices[], const GPaint& paint) override {
+        GTRACE("GCanvas::drawMesh");
+        fCanvas->drawMesh(verts, colors, texs, count, indices, paint);
+    }
+    void drawQuad(const GPoint verts[4], const GColor colors[4], const GPoint texs[4],
+                  int level, const GPaint& paint) override {
+        GTRACE("GCanvas::drawQuad");
+        fCanvas->drawQuad(verts, colors, texs, level, paint);
+    }
+
+    void finish() override {
+        GTRACE("GCanvas::finish");
+        fCanvas->finish();
+    }
+
+    GCanvasStats getStats() const override { return fCanvas->getStats(); }
+    void resetStats() override { fCanvas->resetStats(); }
+
+private:
+    std::unique_ptr<GCanvas> fCanvas;
+};
+
+std::unique_ptr<GCanvas> GCreateTraceCanvas(std::unique_ptr<GCanvas> canvas) {
+    if (!canvas) {
+        return nullptr;
+    }
+    return std::unique_ptr<GCanvas>(new GTraceCanvas(std::move(canvas)));
+}